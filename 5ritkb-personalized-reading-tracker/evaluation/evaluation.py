@@ -0,0 +1,454 @@
+#!/usr/bin/env python3
+"""Run the before/after test suites and write a JSON evaluation report.
+
+Both sides are run against the same ``tests/`` directory at the same time,
+each in its own pytest process, with ``repository_before/`` or
+``repository_after/`` put first on ``PYTHONPATH`` (and exposed as
+``REPO_PATH``) so the tests import the right tree.  Per-test outcomes and
+call durations are collected by ``result_plugin`` (loaded with ``-p``) and
+checked against the ``FAIL_TO_PASS`` / ``PASS_TO_PASS`` lists in
+``instances/instance.json``.  Call durations are summarised per side so the
+report shows latency differences between the two trees next to the test
+results.  Timings taken while other runs share the CPU mostly measure that
+contention, so the summary records the concurrency it was measured at and
+never affects ``success``; use ``--perf`` to run one pytest at a time when
+the numbers are meant to be compared.
+
+A side whose pytest run never finished its session, exited with a status
+other than 0 (all passed), 1 (some failed) or 5 (nothing collected), or hit
+the timeout gets ``status: "error"``, and the evaluation fails.
+
+With ``--root`` every ``instances/instance.json`` found under that directory
+is evaluated in the same process: all before/after runs of all instances
+share one worker pool, so a single container start covers the whole batch,
+and one combined report is written.  Only instances whose environment
+digest (see ``environment_digest``) matches the dataset this runner belongs
+to are run; the others are reported as ``skipped`` since their tests would
+run in the wrong image.  An instance that cannot be loaded or run is
+recorded as ``error`` without stopping the rest of the batch.
+
+Usage::
+
+    python evaluation/evaluation.py [--root DIR] [--jobs N | --perf] [--timeout SECONDS] [--output PATH]
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import platform
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+from collections import Counter, deque
+from concurrent.futures import ThreadPoolExecutor
+from datetime import datetime, timezone
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parent.parent
+SIDES = ("before", "after")
+EVALUATION_DIR = Path(__file__).resolve().parent
+OK_EXIT_STATUSES = {0, 1, 5}
+OUTPUT_TAIL_LINES = 200
+SKIP_DIRS = {"node_modules", "__pycache__", "repository_before", "repository_after", "tests"}
+
+
+def load_instance(root):
+    """Load and validate instances/instance.json; raises ValueError on a bad shape."""
+    with open(root / "instances" / "instance.json", encoding="utf-8") as fp:
+        instance = json.load(fp)
+    if not isinstance(instance, dict):
+        raise ValueError(f"expected a JSON object, got {type(instance).__name__}")
+    for key in ("FAIL_TO_PASS", "PASS_TO_PASS"):
+        tests = instance.get(key, [])
+        if not isinstance(tests, list) or not all(isinstance(t, str) for t in tests):
+            raise ValueError(f"{key} must be a list of test IDs (strings)")
+    for key in ("instance_id", "environment_setup"):
+        if key in instance and not isinstance(instance[key], str):
+            raise ValueError(f"{key} must be a string")
+    return instance
+
+
+def discover_instances(root):
+    """Return every dataset directory under ``root`` holding instances/instance.json."""
+    found = []
+    for dirpath, dirnames, filenames in os.walk(root):
+        dirnames[:] = sorted(d for d in dirnames if not d.startswith(".") and d not in SKIP_DIRS)
+        if Path(dirpath).name == "instances" and "instance.json" in filenames:
+            found.append(Path(dirpath).parent)
+    return found
+
+
+def environment_digest(root, instance=None):
+    """Hash of the files that define an instance's test environment.
+
+    Covers the Dockerfile named by ``environment_setup`` and the
+    ``requirements.txt`` it installs.  The rest of what ``COPY . /app``
+    brings in is the dataset's own source, which docker-compose mounts over
+    ``/app`` anyway.  Returns None when there is no Dockerfile.
+    """
+    dockerfile = root / (instance or {}).get("environment_setup", "Dockerfile")
+    if not dockerfile.is_file():
+        return None
+    digest = hashlib.sha256()
+    for path in (dockerfile, root / "requirements.txt"):
+        digest.update(path.name.encode() + b"\0")
+        digest.update(path.read_bytes() if path.is_file() else b"")
+        digest.update(b"\0")
+    return digest.hexdigest()
+
+
+def fold_phase(outcomes, record):
+    """Fold one plugin record into the per-test outcome map."""
+    nodeid, when, outcome = record["nodeid"], record["when"], record["outcome"]
+    if when in ("collect", "teardown"):
+        if outcome == "failed":
+            outcomes[nodeid] = "ERROR"
+        return
+    if when == "setup":
+        if outcome == "failed":
+            outcomes[nodeid] = "ERROR"
+        elif outcome == "skipped":
+            outcomes[nodeid] = "XFAIL" if record["xfail"] else "SKIPPED"
+        return
+    if outcome == "passed":
+        outcomes[nodeid] = "XPASS" if record["xfail"] else "PASSED"
+    elif outcome == "skipped":
+        outcomes[nodeid] = "XFAIL" if record["xfail"] else "SKIPPED"
+    else:
+        outcomes[nodeid] = "FAILED"
+
+
+def read_result_log(path):
+    """Return ``(tests, durations, exitstatus)`` from a result_plugin log."""
+    tests = {}
+    durations = {}
+    exitstatus = None
+    with open(path, encoding="utf-8") as fp:
+        for line in fp:
+            if not line.endswith("\n"):
+                break  # cut short by a kill mid-write
+            record = json.loads(line)
+            if record.get("event") == "sessionfinish":
+                exitstatus = record["exitstatus"]
+                continue
+            fold_phase(tests, record)
+            if record["when"] == "call":
+                durations[record["nodeid"]] = record["duration"]
+    return tests, durations, exitstatus
+
+
+def percentile(sorted_values, fraction):
+    if not sorted_values:
+        return None
+    index = min(len(sorted_values) - 1, int(round(fraction * (len(sorted_values) - 1))))
+    return sorted_values[index]
+
+
+def summarize_durations(durations):
+    values = sorted(durations.values())
+    return {
+        "count": len(values),
+        "total_seconds": round(sum(values), 6),
+        "p50_seconds": percentile(values, 0.50),
+        "p95_seconds": percentile(values, 0.95),
+        "max_seconds": values[-1] if values else None,
+    }
+
+
+def compare_performance(results, jobs):
+    """Summarise call durations per side, over the tests both sides ran.
+
+    Sides that errored are left out and the ratio is only given when both
+    sides are ok.  ``isolated`` is true when the runs did not overlap
+    (``jobs == 1``), the only case in which the ratio is meaningful.
+    """
+    ok = [side for side in SIDES if results[side]["status"] == "ok"]
+    durations = {side: results[side]["durations"] for side in ok}
+    common = set.intersection(*(set(d) for d in durations.values())) if durations else set()
+    summary = {"jobs": jobs, "isolated": jobs == 1}
+    for side in ok:
+        summary[side] = summarize_durations({t: durations[side][t] for t in common})
+    ratio = None
+    if len(ok) == len(SIDES) and summary["before"]["total_seconds"]:
+        ratio = round(summary["after"]["total_seconds"] / summary["before"]["total_seconds"], 4)
+    summary["after_to_before_ratio"] = ratio
+    return summary
+
+
+def side_error(returncode, exitstatus, timed_out, timeout):
+    if timed_out:
+        return f"timed out after {timeout}s"
+    if exitstatus is None:
+        return f"pytest did not finish its session (exit code {returncode})"
+    if returncode not in OK_EXIT_STATUSES:
+        return f"pytest exited with status {returncode}"
+    return None
+
+
+def drain(stream, tail):
+    for line in stream:
+        tail.append(line.rstrip("\n"))
+
+
+def kill_group(proc):
+    """SIGKILL every process left in the run's process group."""
+    try:
+        os.killpg(proc.pid, signal.SIGKILL)
+    except ProcessLookupError:
+        pass
+
+
+def run_side(root, side, timeout):
+    repo = root / f"repository_{side}"
+    fd, log_path = tempfile.mkstemp(prefix=f"evaluation-{side}-", suffix=".jsonl")
+    os.close(fd)
+    env = dict(os.environ)
+    env["REPO_PATH"] = str(repo)
+    env["PYTHONPATH"] = os.pathsep.join(
+        p for p in (str(repo), str(EVALUATION_DIR), env.get("PYTHONPATH")) if p
+    )
+    env["PYTHONDONTWRITEBYTECODE"] = "1"
+    env["EVALUATION_RESULT_LOG"] = log_path
+    cmd = [
+        sys.executable, "-m", "pytest", "-q",
+        "-p", "no:cacheprovider", "-p", "result_plugin", "--color=no",
+        str(root / "tests"),
+    ]
+
+    tail = deque(maxlen=OUTPUT_TAIL_LINES)
+    timed_out = False
+    started_at = datetime.now(timezone.utc)
+    start = time.monotonic()
+    try:
+        # pytest leads its own process group so a timeout, or the end of the
+        # run, also takes down servers and workers the tests left behind.
+        proc = subprocess.Popen(
+            cmd, cwd=root, env=env, encoding="utf-8", errors="replace",
+            stdout=subprocess.PIPE, stderr=subprocess.STDOUT, start_new_session=True,
+        )
+        reader = threading.Thread(target=drain, args=(proc.stdout, tail), daemon=True)
+        reader.start()
+        try:
+            try:
+                returncode = proc.wait(timeout=timeout or None)
+            except subprocess.TimeoutExpired:
+                timed_out = True
+                kill_group(proc)
+                returncode = proc.wait()
+        except BaseException:
+            kill_group(proc)
+            proc.wait()
+            raise
+        finally:
+            kill_group(proc)
+            reader.join()
+            proc.stdout.close()
+        tests, durations, exitstatus = read_result_log(log_path)
+    finally:
+        os.unlink(log_path)
+
+    error = side_error(returncode, exitstatus, timed_out, timeout)
+    return {
+        "status": "error" if error else "ok",
+        "error": error,
+        "returncode": returncode,
+        "timed_out": timed_out,
+        "started_at": started_at.isoformat(),
+        "finished_at": datetime.now(timezone.utc).isoformat(),
+        "duration_seconds": round(time.monotonic() - start, 3),
+        "tests": tests,
+        "durations": durations,
+        "output": "\n".join(tail),
+    }
+
+
+def passed(tests):
+    return {test for test, outcome in tests.items() if outcome == "PASSED"}
+
+
+def check_expectations(instance, results):
+    """Compare each side's outcomes with FAIL_TO_PASS / PASS_TO_PASS.
+
+    Only the tests that broke an expectation are listed, each with its
+    before/after outcome; every test's outcome is in the per-side ``tests``
+    maps.  IDs listed more than once in the instance are checked once and
+    reported under ``duplicates``.
+    """
+    before = results["before"]["tests"]
+    after = results["after"]["tests"]
+    passed_before = passed(before)
+    passed_after = passed(after)
+    fail_to_pass = Counter(instance.get("FAIL_TO_PASS", []))
+    pass_to_pass = Counter(instance.get("PASS_TO_PASS", []))
+
+    f2p_failed = (fail_to_pass.keys() - passed_after) | (fail_to_pass.keys() & passed_before)
+    p2p_failed = pass_to_pass.keys() - (passed_before & passed_after)
+
+    def section(expected, failed):
+        return {
+            "total": len(expected),
+            "failed": {
+                test: {"before": before.get(test, "MISSING"), "after": after.get(test, "MISSING")}
+                for test in sorted(failed)
+            },
+            "duplicates": sorted(test for test, count in expected.items() if count > 1),
+        }
+
+    return {
+        "FAIL_TO_PASS": section(fail_to_pass, f2p_failed),
+        "PASS_TO_PASS": section(pass_to_pass, p2p_failed),
+        "success": (
+            all(results[side]["status"] == "ok" for side in SIDES)
+            and not f2p_failed and not p2p_failed
+        ),
+    }
+
+
+def environment():
+    return {
+        "python": platform.python_version(),
+        "platform": platform.platform(),
+    }
+
+
+def run_side_safely(root, side, timeout):
+    """``run_side`` that reports a failure to start or read the run as an error side."""
+    try:
+        return run_side(root, side, timeout)
+    except Exception as exc:  # noqa: BLE001 - one broken run must not abort the batch
+        return {
+            "status": "error",
+            "error": f"{type(exc).__name__}: {exc}",
+            "tests": {},
+            "durations": {},
+        }
+
+
+def instance_error(root, status, error, instance=None):
+    return {
+        "instance_id": (instance or {}).get("instance_id"),
+        "dataset": root.name,
+        "status": status,
+        "error": error,
+        "success": False,
+    }
+
+
+def evaluate(roots, jobs, timeout):
+    """Evaluate every dataset in ``roots``; returns one report per dataset."""
+    try:
+        running_digest = environment_digest(ROOT, load_instance(ROOT))
+    except (OSError, ValueError):
+        running_digest = environment_digest(ROOT)
+    reports = [None] * len(roots)
+    runnable = []
+    for index, root in enumerate(roots):
+        try:
+            instance = load_instance(root)
+        except (OSError, ValueError) as exc:
+            reports[index] = instance_error(root, "error", f"cannot load instance.json: {exc}")
+            continue
+        digest = environment_digest(root, instance)
+        if digest != running_digest:
+            reports[index] = instance_error(
+                root, "skipped",
+                f"environment digest {digest} does not match the running environment "
+                f"{running_digest}",
+                instance,
+            )
+            reports[index]["environment_digest"] = digest
+            continue
+        runnable.append((index, root, instance, digest))
+
+    # Queue every (instance, side) run up front so idle workers pick up the
+    # next pending run whichever instance it belongs to.  ``workers`` is how
+    # many runs can really overlap, which is what the timings are labelled with.
+    workers = max(1, min(jobs, len(runnable) * len(SIDES)))
+    with ThreadPoolExecutor(max_workers=workers) as pool:
+        futures = [
+            {side: pool.submit(run_side_safely, root, side, timeout) for side in SIDES}
+            for _, root, _, _ in runnable
+        ]
+        results = [{side: f.result() for side, f in sides.items()} for sides in futures]
+
+    for (index, root, instance, digest), result in zip(runnable, results):
+        report = {
+            "instance_id": instance.get("instance_id"),
+            "dataset": root.name,
+            "environment_digest": digest,
+            "environment": environment(),
+            "before": result["before"],
+            "after": result["after"],
+        }
+        try:
+            report.update(check_expectations(instance, result))
+            report["status"] = "ok" if all(result[side]["status"] == "ok" for side in SIDES) else "error"
+            report["performance"] = compare_performance(result, workers)
+        except Exception as exc:  # noqa: BLE001 - keep the rest of the combined report
+            report.update(instance_error(root, "error", f"cannot check results: "
+                                                        f"{type(exc).__name__}: {exc}", instance))
+        reports[index] = report
+    return reports
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--root", type=Path,
+                        help="evaluate every instances/instance.json under this directory")
+    parser.add_argument("--jobs", type=int,
+                        help="maximum number of test runs in flight "
+                             "(default: 2, or the CPU count with --root)")
+    parser.add_argument("--perf", action="store_true",
+                        help="run one pytest at a time so per-test timings are comparable")
+    parser.add_argument("--timeout", type=float, default=0,
+                        help="per-side timeout in seconds, 0 for none (default: %(default)s)")
+    parser.add_argument("--output", type=Path, default=ROOT / "evaluation" / "report.json",
+                        help="report path (default: evaluation/report.json)")
+    args = parser.parse_args(argv)
+    if args.jobs is not None and args.jobs < 1:
+        parser.error("--jobs must be at least 1")
+    if args.timeout < 0:
+        parser.error("--timeout must not be negative")
+    if args.perf and args.jobs not in (None, 1):
+        parser.error("--perf runs one job at a time and cannot be combined with --jobs")
+
+    if args.root:
+        roots = discover_instances(args.root.resolve())
+        if not roots:
+            parser.error(f"no instances/instance.json found under {args.root}")
+        jobs = args.jobs or os.cpu_count() or 1
+    else:
+        roots = [ROOT]
+        jobs = args.jobs or len(SIDES)
+
+    if args.perf:
+        jobs = 1
+    reports = evaluate(roots, jobs, args.timeout)
+    if args.root:
+        report = {
+            "root": str(args.root),
+            "environment": environment(),
+            "instances": reports,
+            "success": all(r["success"] for r in reports),
+        }
+    else:
+        report = reports[0]
+
+    args.output.parent.mkdir(parents=True, exist_ok=True)
+    with open(args.output, "w", encoding="utf-8") as fp:
+        json.dump(report, fp, indent=2)
+        fp.write("\n")
+
+    for r in reports:
+        verdict = "PASS" if r["success"] else "FAIL" if r["status"] == "ok" else r["status"].upper()
+        print(f"{r['instance_id'] or r['dataset']}: {verdict}")
+    print(f"report -> {args.output}")
+    return 0 if report["success"] else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
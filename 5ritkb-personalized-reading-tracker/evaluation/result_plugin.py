@@ -0,0 +1,50 @@
+"""pytest plugin that writes per-test results for evaluation.py.
+
+Loaded with ``-p result_plugin``; each test phase is appended as one JSON
+line to the file named by ``EVALUATION_RESULT_LOG``, followed by a final
+``sessionfinish`` record carrying pytest's exit status.
+"""
+
+import json
+import os
+
+_log = None
+
+
+def _write(record):
+    if _log is not None:
+        _log.write(json.dumps(record) + "\n")
+        _log.flush()
+
+
+def pytest_configure(config):
+    global _log
+    path = os.environ.get("EVALUATION_RESULT_LOG")
+    if path and _log is None:
+        _log = open(path, "a", encoding="utf-8")
+
+
+def pytest_collectreport(report):
+    if report.failed:
+        _write({"nodeid": report.nodeid, "when": "collect", "outcome": "failed", "xfail": False})
+
+
+def pytest_runtest_logreport(report):
+    _write({
+        "nodeid": report.nodeid,
+        "when": report.when,
+        "outcome": report.outcome,
+        "xfail": hasattr(report, "wasxfail"),
+        "duration": report.duration,
+    })
+
+
+def pytest_sessionfinish(session, exitstatus):
+    _write({"event": "sessionfinish", "exitstatus": int(exitstatus)})
+
+
+def pytest_unconfigure(config):
+    global _log
+    if _log is not None:
+        _log.close()
+        _log = None